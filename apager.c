@@ -1,7 +1,21 @@
 #include "parser.h"
 #include <stdio.h>
+#include <string.h>
 
 int main(int argc, char** argv, char** envp) {
+    int eager = 0, shared = 0;
+
+    // --eager: make the whole image resident before entry (no faults after the jump).
+    // --shared: map file-backed pages from a post-load image shared by all instances.
+    for (; argc > 1; argc--, argv++) {
+        if (strcmp(argv[1], "--eager") == 0)
+            eager = 1;
+        else if (strcmp(argv[1], "--shared") == 0)
+            shared = 1;
+        else
+            break;
+    }
+
     if (argc == 1) {
         fprintf(stderr, "main: No program specified.\n");
         exit(EXIT_FAILURE);
@@ -13,6 +27,8 @@ int main(int argc, char** argv, char** envp) {
         fprintf(stderr, "main: Failed to parse file.\n");
         exit(EXIT_FAILURE);
     }
+    fp->eager = eager;
+    fp->shared = shared;
 
     if (load_elf_binary(fp) != 0) {
         fprintf(stderr, "main: Loading ELF binary failed.\n");
@@ -86,6 +86,14 @@ int allocate_page(Elf64_Phdr *fault_hdr, void* fault_addr_ptr) {
     // Faulting address is mapped to file.
     // maint that fault_hdr->p_offset maps to fault_hdr->p_vaddr
     unsigned long off = fault_hdr->p_offset + fault_page_start - fault_hdr->p_vaddr;
+    unsigned long file_end = fault_hdr->p_offset + fault_hdr->p_filesz;
+
+    // Streamed image: block until the faulting page has landed in the memfd.
+    if (fp->stream && stream_wait(fp->stream, off + 4096 < file_end ? off + 4096 : file_end) == -1) {
+        printf("allocate_page: stream failed before offset %lu arrived: %s\n", off,
+            fp->stream->err ? strerror(fp->stream->err) : "unexpected end of input");
+        return -1;
+    }
     printf("file-backed mapping: file %d, offset %lu, size %lu, address %p\n", fileno(fp->elf_file), off, 4096, (void*)fault_page_start);
     map_addr_ptr = mmap((void*) fault_page_start, 4096, PROT_EXEC | PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp->elf_file), off);
     if (map_addr_ptr == MAP_FAILED) {
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,8 +7,23 @@
 #include <sys/mman.h>
 #include <elf.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#ifdef APAGER
+#include <time.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#endif
 
 #include "parser.h"
+#ifdef LOAD_PLAN
+#include "load_plan.h"
+#endif
 
 /**
  * Routine for checking stack made for child program.
@@ -108,6 +124,165 @@ out:
     return elf_ex;
 }
 
+/**
+ * futex(2) without glibc's syscall() wrapper, which stores errno through %fs.
+ * In dpager's fault handler %fs already points at the guest's TLS.
+ */
+long raw_futex(int *uaddr, int op, int val) {
+    long ret;
+
+    asm volatile(
+        "mov %[zero], %%r10\n"
+        "syscall\n"
+        : "=a" (ret)
+        : "0" ((long) SYS_futex), "D" (uaddr), "S" ((long) op), "d" ((long) val), [zero] "r" (0L)
+        : "rcx", "r10", "r11", "memory"
+    );
+    return ret;
+}
+
+void stream_publish(struct elf_stream *s) {
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_RELEASE);
+    raw_futex(&s->seq, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+/**
+ * Copies the source pipe into the memfd until `end` bytes have landed or the
+ * pipe hits EOF. Progress is published after every read so faults blocked in
+ * stream_wait resume as soon as their range is in.
+ */
+int stream_fill(struct elf_stream *s, unsigned long end) {
+    ssize_t n, w, off;
+
+    while (s->received < end) {
+        n = read(s->in_fd, s->buf, STREAM_BUF_SIZE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n;
+
+        for (off = 0; off < n; off += w) {
+            w = pwrite(s->mem_fd, s->buf + off, n - off, s->received + off);
+            if (w < 0 && errno == EINTR)
+                w = 0;
+            else if (w < 0)
+                return -1;
+        }
+        __atomic_store_n(&s->received, s->received + n, __ATOMIC_RELEASE);
+        stream_publish(s);
+    }
+    return 0;
+}
+
+/**
+ * Releases the source fd. stdin belongs to the guest too, so it is pointed at
+ * /dev/null instead of closed; otherwise the guest's next open() would get 0.
+ */
+void stream_close_input(int in_fd, int owns_fd) {
+    int null_fd;
+
+    if (owns_fd) {
+        close(in_fd);
+        return;
+    }
+    null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd != -1 && null_fd != in_fd) {
+        dup2(null_fd, in_fd);
+        close(null_fd);
+    }
+}
+
+void *stream_reader(void *arg) {
+    struct elf_stream *s = arg;
+
+    if (stream_fill(s, ULONG_MAX) == -1)
+        s->err = errno;
+    // No shared writable mappings exist, so F_SEAL_WRITE cannot fail with EBUSY.
+    else if (fcntl(s->mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+        s->err = errno;
+
+    // Entry does not wait for trailing non-loadable data, so report failures here.
+    if (s->err)
+        fprintf(stderr, "stream_reader: Failed to receive or seal image: %s\n", strerror(s->err));
+
+    stream_close_input(s->in_fd, s->owns_fd);
+    __atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+    stream_publish(s);
+    return NULL;
+}
+
+/**
+ * Blocks until the first `end` bytes of a streamed image are in the memfd.
+ * Never touches errno, so dpager's fault handler can call it.
+ * Returns -1 if the stream ended before reaching `end`, or if the reader has
+ * already hit a read or sealing error (left in s->err).
+ */
+int stream_wait(struct elf_stream *s, unsigned long end) {
+    int seq;
+
+    for (;;) {
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->done, __ATOMIC_ACQUIRE) && s->err)
+            return -1;
+        if (__atomic_load_n(&s->received, __ATOMIC_ACQUIRE) >= end)
+            return 0;
+        if (__atomic_load_n(&s->done, __ATOMIC_ACQUIRE))
+            return -1;
+        raw_futex(&s->seq, FUTEX_WAIT_PRIVATE, seq);
+    }
+}
+
+/**
+ * Starts streaming an ELF image from a non-seekable fd into a memfd. The
+ * ELF and program headers are received before returning so they can be
+ * parsed right away; the rest keeps arriving on a reader thread.
+ */
+struct elf_stream *stream_open(int in_fd, int owns_fd) {
+    struct elf_stream *s = NULL;
+    Elf64_Ehdr elf_ex;
+    unsigned long ph_end;
+
+    s = calloc(1, sizeof(struct elf_stream));
+    if (!s) {
+        stream_close_input(in_fd, owns_fd);
+        goto err;
+    }
+    s->in_fd = in_fd;
+    s->owns_fd = owns_fd;
+    s->buf = malloc(STREAM_BUF_SIZE);
+    s->mem_fd = memfd_create("elf-stream", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (!s->buf || s->mem_fd == -1)
+        goto err;
+
+    if (stream_fill(s, sizeof(Elf64_Ehdr)) == -1 || s->received < sizeof(Elf64_Ehdr))
+        goto err;
+    if (pread(s->mem_fd, &elf_ex, sizeof(Elf64_Ehdr), 0) != sizeof(Elf64_Ehdr))
+        goto err;
+    // Reject non-ELF sources (e.g. /dev/zero) before streaming them without bound.
+    if (memcmp(elf_ex.e_ident, ELFMAG, SELFMAG) != 0 || elf_ex.e_ident[EI_CLASS] != ELFCLASS64) {
+        fprintf(stderr, "stream_open: Input is not a 64-bit ELF file.\n");
+        goto err;
+    }
+    ph_end = elf_ex.e_phoff + (unsigned long) elf_ex.e_phnum * sizeof(Elf64_Phdr);
+    if (stream_fill(s, ph_end) == -1 || s->received < ph_end)
+        goto err;
+
+    if (pthread_create(&s->reader, NULL, stream_reader, s) != 0)
+        goto err;
+    return s;
+
+err:
+    fprintf(stderr, "stream_open: Failed to receive ELF headers.\n");
+    if (s) {
+        stream_close_input(s->in_fd, s->owns_fd);
+        if (s->mem_fd != -1)
+            close(s->mem_fd);
+        free(s->buf);
+        free(s);
+    }
+    return NULL;
+}
+
 unsigned long elf_map(FILE *elf_file, unsigned long addr, Elf64_Phdr *elf_ppnt, int elf_prot, int elf_flags) {
     void *map_addr_ptr = NULL;
     unsigned long map_addr;
@@ -298,7 +473,7 @@ void* setup_stack(struct binary_file* fp, unsigned long phdr, unsigned long e_en
 
         switch (auxv[i].a_type) {
             case AT_PHDR:
-                ((Elf64_auxv_t*) new_auxv_start)[i].a_un.a_val = 0;
+                ((Elf64_auxv_t*) new_auxv_start)[i].a_un.a_val = phdr;
                 break;
             case AT_ENTRY:
                 ((Elf64_auxv_t*) new_auxv_start)[i].a_un.a_val = e_entry;
@@ -342,6 +517,474 @@ int padzero(unsigned long elf_bss) {
     return 0;
 }
 
+#ifdef APAGER
+#define PREFAULT_MAX_THREADS 4
+#define PREFAULT_CHUNK (2UL << 20)
+#define PREFAULT_PARALLEL_MIN (16UL << 20) // images smaller than this are prefaulted inline.
+
+struct prefault_range {
+    unsigned long start;
+    unsigned long end;
+    int write; // segment is writable, so break COW now instead of on first store.
+};
+
+struct prefault_job {
+    struct prefault_range *ranges;
+    int nranges;
+    int id;
+    int nthreads;
+    int err;
+};
+
+/**
+ * Populates [addr, addr + len). Falls back to touching every page when the
+ * kernel predates MADV_POPULATE_READ/WRITE (< 5.14).
+ */
+int prefault_chunk(unsigned long addr, unsigned long len, int write) {
+    unsigned long p;
+
+    if (madvise((void*) addr, len, write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0)
+        return 0;
+    if (errno != EINVAL)
+        return -1;
+
+    for (p = addr; p < addr + len; p += ELF_MIN_ALIGN) {
+        if (write)
+            *(volatile char*) p = *(volatile char*) p;
+        else
+            (void) *(volatile char*) p;
+    }
+    return 0;
+}
+
+/**
+ * Walks every range in PREFAULT_CHUNK steps and populates the chunks whose
+ * index maps to this worker, so large segments are spread over all threads.
+ */
+void *prefault_worker(void *arg) {
+    struct prefault_job *job = arg;
+    unsigned long addr, len, chunk = 0;
+    int i;
+
+    for (i = 0; i < job->nranges; i++) {
+        for (addr = job->ranges[i].start; addr < job->ranges[i].end; addr += PREFAULT_CHUNK, chunk++) {
+            if (chunk % job->nthreads != job->id)
+                continue;
+            len = job->ranges[i].end - addr;
+            if (len > PREFAULT_CHUNK)
+                len = PREFAULT_CHUNK;
+            if (prefault_chunk(addr, len, job->ranges[i].write) == -1) {
+                job->err = errno;
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+#define PAGEMAP_PRESENT (1UL << 63)
+#define PAGEMAP_FILE (1UL << 61) // file page or shared anon, i.e. COW not yet broken.
+
+/**
+ * Adds to *missing the pages of `range` that would still fault: pages with no
+ * PTE, and for writable ranges pages still backed by the file.
+ */
+int count_unmapped(struct prefault_range *range, unsigned long *missing) {
+    unsigned long npages = (range->end - range->start) / ELF_MIN_ALIGN, j;
+    uint64_t *entries;
+    int fd, err = 0;
+
+    fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    entries = malloc(npages * sizeof(uint64_t));
+    if (fd == -1 || !entries ||
+        pread(fd, entries, npages * sizeof(uint64_t), range->start / ELF_MIN_ALIGN * sizeof(uint64_t)) != npages * sizeof(uint64_t)) {
+        err = -1;
+        goto out;
+    }
+
+    for (j = 0; j < npages; j++) {
+        if (!(entries[j] & PAGEMAP_PRESENT) || (range->write && (entries[j] & PAGEMAP_FILE)))
+            (*missing)++;
+    }
+
+out:
+    free(entries);
+    if (fd != -1)
+        close(fd);
+    return err;
+}
+
+/**
+ * Maps every page of `ranges` into this process's page tables, so the guest
+ * takes no faults on its image. Reports time-to-resident on stderr and fails
+ * if /proc/self/pagemap still shows a page that would fault.
+ */
+int prefault_ranges(struct prefault_range *ranges, int nranges) {
+    struct prefault_job jobs[PREFAULT_MAX_THREADS];
+    pthread_t threads[PREFAULT_MAX_THREADS];
+    struct timespec t_start, t_end;
+    struct rusage ru_start, ru_end;
+    unsigned long total = 0, missing = 0;
+    int nthreads = 1, started, i, err = 0;
+    long ncpu;
+
+    for (i = 0; i < nranges; i++) {
+        total += ranges[i].end - ranges[i].start;
+    }
+
+    if (total >= PREFAULT_PARALLEL_MIN) {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > PREFAULT_MAX_THREADS ? PREFAULT_MAX_THREADS : (ncpu > 1 ? ncpu : 1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    getrusage(RUSAGE_SELF, &ru_start);
+
+    for (i = 0; i < nthreads; i++) {
+        jobs[i] = (struct prefault_job) { ranges, nranges, i, nthreads, 0 };
+    }
+    // Thread 0's share runs on the loader thread itself.
+    for (started = 1; started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, prefault_worker, &jobs[started]) != 0)
+            break;
+    }
+    prefault_worker(&jobs[0]);
+    for (i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // Pick up any shares left behind by threads that failed to start.
+    for (i = started; i < nthreads; i++) {
+        prefault_worker(&jobs[i]);
+    }
+
+    getrusage(RUSAGE_SELF, &ru_end);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    for (i = 0; i < nthreads; i++) {
+        if (jobs[i].err) {
+            fprintf(stderr, "prefault_ranges: populate failed: %s\n", strerror(jobs[i].err));
+            err = -1;
+        }
+    }
+
+    // Confirm that this process's page tables now map every page.
+    for (i = 0; i < nranges && !err; i++) {
+        if (count_unmapped(&ranges[i], &missing) == -1) {
+            perror("prefault_ranges: Failed to read /proc/self/pagemap");
+            err = -1;
+        }
+    }
+
+    fprintf(stderr, "prefault: %lu pages mapped in %ld us (%d threads, %ld minor / %ld major faults while prefaulting)\n",
+        total / ELF_MIN_ALIGN - missing,
+        (t_end.tv_sec - t_start.tv_sec) * 1000000 + (t_end.tv_nsec - t_start.tv_nsec) / 1000,
+        started,
+        ru_end.ru_minflt - ru_start.ru_minflt,
+        ru_end.ru_majflt - ru_start.ru_majflt);
+
+    if (missing) {
+        fprintf(stderr, "prefault_ranges: %lu pages still fault on first access.\n", missing);
+        err = -1;
+    }
+
+    return err;
+}
+
+/**
+ * Prefaults every PT_LOAD segment, writable ones with their COW already broken.
+ */
+int prefault_segments(struct binary_file* fp) {
+    Elf64_Ehdr *elf_ex = fp->elf_ex;
+    Elf64_Phdr *elf_ppnt = fp->elf_phdata;
+    struct prefault_range *ranges;
+    int nranges = 0, i, err;
+
+    ranges = malloc(sizeof(struct prefault_range) * elf_ex->e_phnum);
+    if (!ranges)
+        return -1;
+
+    for (i = 0; i < elf_ex->e_phnum; i++, elf_ppnt++) {
+        if (elf_ppnt->p_type != PT_LOAD || !elf_ppnt->p_memsz)
+            continue;
+        ranges[nranges].start = ELF_PAGESTART(elf_ppnt->p_vaddr);
+        ranges[nranges].end = ELF_PAGEALIGN(elf_ppnt->p_vaddr + elf_ppnt->p_memsz);
+        ranges[nranges].write = !!(elf_ppnt->p_flags & PF_W);
+        nranges++;
+    }
+
+    err = prefault_ranges(ranges, nranges);
+    free(ranges);
+    return err;
+}
+
+/**
+ * Prints the fault counters at entry. Faults taken after entry are the
+ * process total (e.g. from getrusage at exit) minus these.
+ */
+void report_entry_faults(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(stderr, "prefault: %ld minor / %ld major faults before entry\n", ru.ru_minflt, ru.ru_majflt);
+}
+#endif
+
+#ifdef APAGER
+#define SHARED_IMAGE_DIR "/dev/shm/elf-image-%d/" // one 0700 directory per user.
+
+/**
+ * Writes the post-load contents of every file-backed page (file bytes, with
+ * the tail of each BSS boundary page zeroed) at their offset from `base`.
+ * Gaps between segments are left as holes.
+ */
+int shared_image_build(struct binary_file* fp, int fd, unsigned long base, unsigned long size) {
+    Elf64_Phdr *elf_ppnt = fp->elf_phdata;
+    unsigned long start, end, len;
+    char *buf;
+    int i, err = 0;
+
+    if (ftruncate(fd, size) == -1)
+        return -1;
+
+    for (i = 0; i < fp->elf_ex->e_phnum && !err; i++, elf_ppnt++) {
+        if (elf_ppnt->p_type != PT_LOAD || !elf_ppnt->p_filesz)
+            continue;
+        start = ELF_PAGESTART(elf_ppnt->p_vaddr);
+        end = elf_ppnt->p_vaddr + elf_ppnt->p_filesz;
+        len = ELF_PAGEALIGN(end) - start;
+
+        buf = calloc(1, len);
+        if (!buf)
+            return -1;
+        if (pread(fileno(fp->elf_file), buf, end - start, elf_ppnt->p_offset - ELF_PAGEOFFSET(elf_ppnt->p_vaddr)) != end - start)
+            err = -1;
+        // Beyond p_filesz the page holds file bytes unless the segment has a BSS.
+        if (!err && elf_ppnt->p_memsz > elf_ppnt->p_filesz)
+            memset(buf + end - start, 0, len - (end - start));
+        else if (!err && pread(fileno(fp->elf_file), buf + end - start, len - (end - start), elf_ppnt->p_offset + elf_ppnt->p_filesz) < 0)
+            err = -1;
+        if (!err && pwrite(fd, buf, len, start - base) != len)
+            err = -1;
+        free(buf);
+    }
+    return err;
+}
+
+/**
+ * Only images this user wrote and nobody else can modify are mapped; a short
+ * image would SIGBUS the guest mid-run, so its size must match too.
+ */
+int shared_image_trusted(int fd, unsigned long size) {
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid() &&
+        !(st.st_mode & (S_IWGRP | S_IWOTH)) && st.st_size == size;
+}
+
+/**
+ * Unlinks images (and their lock files) left by earlier builds of the same
+ * file, i.e. names sharing its dev-ino prefix. Running instances keep their
+ * mappings; the memory goes once the last one exits. Other builders' temp
+ * files (name.pid) are left alone so their publish still succeeds.
+ */
+void shared_image_reclaim(const char *dir, const char *name, size_t prefix_len) {
+    char path[320];
+    struct dirent *ent;
+    const char *dot;
+    DIR *d;
+
+    d = opendir(dir);
+    if (!d)
+        return;
+    while ((ent = readdir(d)) != NULL) {
+        if (strncmp(ent->d_name, name, prefix_len) != 0 || strncmp(ent->d_name, name, strlen(name)) == 0)
+            continue;
+        dot = strchr(ent->d_name, '.');
+        if (!dot || (strchr(dot + 1, '.') && strcmp(strrchr(ent->d_name, '.'), ".lock") != 0))
+            continue;
+        snprintf(path, sizeof(path), "%s%s", dir, ent->d_name);
+        if (unlink(path) == 0 && !strchr(dot + 1, '.'))
+            fprintf(stderr, "shared image: removed stale %s\n", path);
+    }
+    closedir(d);
+}
+
+/**
+ * Opens the shared post-load image for this binary, building it if no other
+ * instance has yet. The name is derived from the file's identity so a rebuilt
+ * binary never maps a stale image; builders serialize on a lock file and
+ * publish with rename, so readers never see a partial image.
+ */
+int shared_image_open(struct binary_file* fp, unsigned long *base_out) {
+    Elf64_Phdr *elf_ppnt = fp->elf_phdata;
+    char dir[64], name[96], path[192], tmp[208], lock[208];
+    size_t prefix_len;
+    unsigned long base = ULONG_MAX, end = 0;
+    struct stat st;
+    int fd, lock_fd, i;
+
+    for (i = 0; i < fp->elf_ex->e_phnum; i++, elf_ppnt++) {
+        if (elf_ppnt->p_type != PT_LOAD || !elf_ppnt->p_filesz)
+            continue;
+        if (ELF_PAGESTART(elf_ppnt->p_vaddr) < base)
+            base = ELF_PAGESTART(elf_ppnt->p_vaddr);
+        if (ELF_PAGEALIGN(elf_ppnt->p_vaddr + elf_ppnt->p_filesz) > end)
+            end = ELF_PAGEALIGN(elf_ppnt->p_vaddr + elf_ppnt->p_filesz);
+    }
+    if (end <= base || fstat(fileno(fp->elf_file), &st) == -1)
+        return -1;
+    *base_out = base;
+
+    // dev-ino identifies the file across rebuilds; size and mtime identify this build.
+    prefix_len = snprintf(name, sizeof(name), "%lx-%lx-", (unsigned long) st.st_dev, (unsigned long) st.st_ino);
+    snprintf(name + prefix_len, sizeof(name) - prefix_len, "%lx-%lx.%09lx",
+        (unsigned long) st.st_size, (unsigned long) st.st_mtim.tv_sec, (unsigned long) st.st_mtim.tv_nsec);
+    snprintf(dir, sizeof(dir), SHARED_IMAGE_DIR, (int) geteuid());
+    snprintf(path, sizeof(path), "%s%s", dir, name);
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    snprintf(lock, sizeof(lock), "%s.lock", path);
+
+    // Someone else may have planted the directory; only use one we own and alone can write.
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+        return -1;
+    if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077)) {
+        fprintf(stderr, "shared_image_open: %s is not a private directory.\n", dir);
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd != -1 && shared_image_trusted(fd, end - base))
+        return fd;
+    if (fd != -1) {
+        fprintf(stderr, "shared_image_open: Ignoring untrusted or short image %s.\n", path);
+        close(fd);
+        return -1;
+    }
+
+    lock_fd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (lock_fd == -1 || flock(lock_fd, LOCK_EX) == -1) {
+        perror("shared_image_open: Failed to lock shared image");
+        if (lock_fd != -1)
+            close(lock_fd);
+        return -1;
+    }
+
+    // Another instance may have published it while we waited for the lock.
+    fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) {
+        fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0400);
+        if (fd != -1 && (shared_image_build(fp, fd, base, end - base) == -1 || rename(tmp, path) == -1)) {
+            perror("shared_image_open: Failed to build shared image");
+            unlink(tmp);
+            close(fd);
+            fd = -1;
+        } else if (fd != -1) {
+            fprintf(stderr, "shared image: built %s (%lu pages)\n", path, (end - base) / ELF_MIN_ALIGN);
+            shared_image_reclaim(dir, name, prefix_len);
+        }
+    }
+    close(lock_fd);
+
+    if (fd != -1 && !shared_image_trusted(fd, end - base)) {
+        fprintf(stderr, "shared_image_open: Ignoring untrusted or short image %s.\n", path);
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * Maps a segment's file-backed pages from the shared image and the rest of
+ * its BSS as anonymous memory. The boundary page is already zeroed in the
+ * image, so it stays shared until the guest writes to it.
+ */
+int elf_load_shared(int image_fd, unsigned long base, Elf64_Phdr *elf_ppnt, int elf_flags) {
+    unsigned long addr = ELF_PAGESTART(elf_ppnt->p_vaddr);
+    unsigned long file_end = elf_ppnt->p_filesz ? ELF_PAGEALIGN(elf_ppnt->p_vaddr + elf_ppnt->p_filesz) : addr; // pure-BSS segments have no pages in the image.
+    unsigned long mem_end = ELF_PAGEALIGN(elf_ppnt->p_vaddr + elf_ppnt->p_memsz);
+    void *map_addr_ptr;
+
+    if (file_end > addr) {
+        map_addr_ptr = mmap((void*) addr, file_end - addr, (PROT_EXEC | PROT_READ | PROT_WRITE), elf_flags, image_fd, addr - base);
+        if (map_addr_ptr == MAP_FAILED) {
+            perror("elf_load_shared: Failed to map ELF segment");
+            return -1;
+        }
+        addr = file_end;
+    }
+
+    if (mem_end > addr) {
+        map_addr_ptr = mmap((void*) addr, mem_end - addr, (PROT_EXEC | PROT_READ | PROT_WRITE), elf_flags | MAP_ANONYMOUS, -1, 0);
+        if (map_addr_ptr == MAP_FAILED) {
+            perror("elf_load_shared: Failed to map ELF bss");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+void start_guest(void* sp, unsigned long entry) {
+    asm volatile(
+        "mov %0, %%rsp\n"
+        "mov %1, %%rax\n"
+        "xorq %%rdx, %%rdx\n" // glibc segfaults if this reg is not zeroed out 💀.
+        "jmp *%%rax\n"
+        :
+        : "r" (sp), "r" (entry)
+    );
+}
+
+#ifdef LOAD_PLAN
+/**
+ * Replays the load plan compiled in from load_plan.h: no header parsing and
+ * no per-segment decisions, only an identity check and the recorded mmaps.
+ */
+uintptr_t load_planned_binary(struct binary_file* fp) {
+    struct prefault_range ranges[sizeof(plan_maps) / sizeof(plan_maps[0])];
+    struct stat st;
+    void* sp;
+    int i;
+
+    if (fp->stream || fp->shared) {
+        fprintf(stderr, "load_planned_binary: Streamed input and --shared are not supported with a load plan.\n");
+        return -1;
+    }
+
+    if (fstat(fileno(fp->elf_file), &st) == -1 || st.st_size != PLAN_SIZE ||
+        st.st_mtim.tv_sec != PLAN_MTIME_SEC || st.st_mtim.tv_nsec != PLAN_MTIME_NSEC) {
+        fprintf(stderr, "load_planned_binary: %s does not match the compiled load plan.\n", fp->argv[0]);
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(plan_maps) / sizeof(plan_maps[0]); i++) {
+        if (mmap((void*) plan_maps[i].addr, plan_maps[i].len, (PROT_EXEC | PROT_READ | PROT_WRITE),
+                plan_maps[i].off == -1 ? MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS : MAP_PRIVATE | MAP_FIXED,
+                plan_maps[i].off == -1 ? -1 : fileno(fp->elf_file),
+                plan_maps[i].off == -1 ? 0 : plan_maps[i].off) == MAP_FAILED) {
+            perror("load_planned_binary: Failed to map ELF segment");
+            return -1;
+        }
+        ranges[i] = (struct prefault_range) { plan_maps[i].addr, plan_maps[i].addr + plan_maps[i].len, plan_maps[i].write };
+    }
+    for (i = 0; i < PLAN_NZERO; i++) {
+        memset((void*) plan_zero[i].start, 0, plan_zero[i].end - plan_zero[i].start);
+    }
+
+    if (fp->eager && prefault_ranges(ranges, sizeof(plan_maps) / sizeof(plan_maps[0])) != 0) {
+        fprintf(stderr, "load_planned_binary: Failed to prefault ELF segments.\n");
+        return -1;
+    }
+
+    sp = setup_stack(fp, PLAN_PHDR, PLAN_ENTRY, PLAN_PHNUM, sizeof(Elf64_Phdr), PLAN_ENTRY);
+    if (fp->eager)
+        report_entry_faults();
+    start_guest(sp, PLAN_ENTRY);
+    return 0;
+}
+#endif
+
 uintptr_t load_elf_binary(struct binary_file* fp) {
     FILE *elf_file = fp->elf_file;
 	Elf64_Ehdr *elf_ex = fp->elf_ex;
@@ -354,6 +997,22 @@ uintptr_t load_elf_binary(struct binary_file* fp) {
     unsigned long elf_bss = 0, elf_brk = 0;
     int bss_prot = 0;
 
+#ifdef LOAD_PLAN
+    return load_planned_binary(fp);
+#endif
+
+#ifdef APAGER
+    unsigned long image_base = 0;
+    int image_fd = -1;
+
+    // Streamed images have no stable identity to name a shared image after.
+    if (fp->shared && !fp->stream) {
+        image_fd = shared_image_open(fp, &image_base);
+        if (image_fd == -1)
+            fprintf(stderr, "load_elf_binary: Shared image unavailable, mapping from the ELF file.\n");
+    }
+#endif
+
     // Start line 1024 in binfmt_elf.c
     // First loaded segment shouldn't have MAP_FIXED, rest should.
     elf_ppnt = elf_phdata;
@@ -376,7 +1035,17 @@ uintptr_t load_elf_binary(struct binary_file* fp) {
             elf_flags |= MAP_FIXED;
         }
 #ifdef APAGER
-        error = elf_load(elf_file, elf_ppnt->p_vaddr, elf_ppnt, elf_prot, elf_flags);
+        if (fp->stream && stream_wait(fp->stream, elf_ppnt->p_offset + elf_ppnt->p_filesz) == -1) {
+            fprintf(stderr, "load_elf_binary: Stream failed before segment %d arrived: %s\n", i,
+                fp->stream->err ? strerror(fp->stream->err) : "unexpected end of input");
+            return -1;
+        }
+        if (image_fd != -1) {
+            if (elf_load_shared(image_fd, image_base, elf_ppnt, elf_flags) == -1)
+                return -1;
+        } else {
+            error = elf_load(elf_file, elf_ppnt->p_vaddr, elf_ppnt, elf_prot, elf_flags);
+        }
 #elif defined(DPAGER)
         // DPAGER code here.
         printf("loading page\n");
@@ -385,7 +1054,8 @@ uintptr_t load_elf_binary(struct binary_file* fp) {
         unsigned long addr = ELF_PAGESTART(elf_ppnt->p_vaddr);
         unsigned long size = 4096;
         off += addr - ELF_PAGESTART(elf_ppnt->p_vaddr);
-        if (mmap((void*) addr, size, elf_prot,  MAP_PRIVATE | MAP_FIXED | MAP_EXECUTABLE, fd, off) == MAP_FAILED) {
+        // Streamed images fault in every page, so the handler can wait for it to arrive.
+        if (!fp->stream && mmap((void*) addr, size, elf_prot,  MAP_PRIVATE | MAP_FIXED | MAP_EXECUTABLE, fd, off) == MAP_FAILED) {
             printf("load_elf_binary: mmap failed: %s\n", strerror(errno));
             exit(-1);
         }
@@ -414,23 +1084,30 @@ uintptr_t load_elf_binary(struct binary_file* fp) {
 		}
     }
 
+#ifdef APAGER
+    if (fp->eager && prefault_segments(fp) != 0) {
+        fprintf(stderr, "load_elf_binary: Failed to prefault ELF segments.\n");
+        return -1;
+    }
+#endif
+
     // printf("\nSETTING UP STACK:\n\n");
     char* sp = setup_stack(fp, phdr_addr, elf_ex->e_entry, elf_ex->e_phnum, elf_ex->e_phentsize, elf_ex->e_entry); // stack stuff.
 
-    asm volatile(
-        "mov %0, %%rsp\n"
-        "mov %1, %%rax\n"
-        "xorq %%rdx, %%rdx\n" // glibc segfaults if this reg is not zeroed out 💀.
-        "jmp *%%rax\n"
-        :
-        : "r" (sp), "r" (elf_ex->e_entry)
-    );
+#ifdef APAGER
+    if (fp->eager)
+        report_entry_faults();
+#endif
+
+    start_guest(sp, elf_ex->e_entry);
 
     return 0;
 }
 
 struct binary_file *parse_file(int argc, char** argv, char** envp) {
     struct binary_file* fp = malloc(sizeof(struct binary_file));
+    struct stat st;
+    int in_fd;
     if (fp == NULL) {
         fprintf(stderr, "parse_file: Failed to allocate memory for binary file.\n");
         return NULL;
@@ -439,14 +1116,31 @@ struct binary_file *parse_file(int argc, char** argv, char** envp) {
     fp->argc = --argc;
     fp->argv = &argv[1];
     fp->envp = envp;
+    fp->eager = 0;
+    fp->shared = 0;
+    fp->stream = NULL;
     
-    // Open elf_file.
-    fp->elf_file = fopen(argv[1], "r+");
+    // Open elf_file. Stdin ("-") and pipes are streamed into a memfd instead.
+    if (strcmp(argv[1], "-") == 0 || (stat(argv[1], &st) == 0 && !S_ISREG(st.st_mode))) {
+        in_fd = strcmp(argv[1], "-") == 0 ? STDIN_FILENO : open(argv[1], O_RDONLY);
+        if (in_fd != -1)
+            fp->stream = stream_open(in_fd, in_fd != STDIN_FILENO);
+        fp->elf_file = fp->stream ? fdopen(fp->stream->mem_fd, "r") : NULL;
+    } else {
+        fp->elf_file = fopen(argv[1], "r+");
+    }
     if (fp->elf_file == NULL) {
         fprintf(stderr, "parse_file: Failed to open executable file.\n");
         return NULL;
     }
 
+#ifdef LOAD_PLAN
+    // Headers are already baked into load_plan.h.
+    fp->elf_ex = NULL;
+    fp->elf_phdata = NULL;
+    return fp;
+#endif
+
     // Read ELF header.
     fp->elf_ex = load_elf_ex(fp->elf_file);
     if (!fp->elf_ex) {
@@ -3,6 +3,7 @@
 #include <signal.h>
 #include <elf.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #define STACK_SIZE 8192
 #define ELF_MIN_ALIGN	4096
@@ -10,6 +11,34 @@
 #define ELF_PAGEALIGN(_v) (((_v) + ELF_MIN_ALIGN - 1) & ~(ELF_MIN_ALIGN - 1))
 #define ELF_PAGEOFFSET(_v) ((_v) & (ELF_MIN_ALIGN - 1))
 
+#define STREAM_BUF_SIZE 65536
+
+// Image arriving over a pipe; a reader thread copies it into mem_fd.
+struct elf_stream {
+    int in_fd;
+    int owns_fd; // in_fd was opened by parse_file; otherwise it is the guest's stdin.
+    int mem_fd;
+    unsigned long received; // bytes of the image already in mem_fd.
+    int seq; // futex word, bumped whenever received or done changes.
+    int done;
+    int err;
+    char* buf;
+    pthread_t reader;
+};
+
+// Load plan entries emitted by plangen. off == -1 marks an anonymous mapping.
+struct plan_map {
+    unsigned long addr;
+    unsigned long len;
+    long off;
+    int write; // from PF_W; --eager breaks COW on these pages up front.
+};
+
+struct plan_range {
+    unsigned long start;
+    unsigned long end;
+};
+
 struct binary_file {
     int argc;
     char** argv;
@@ -17,6 +46,9 @@ struct binary_file {
     FILE* elf_file;
     Elf64_Ehdr* elf_ex;
     Elf64_Phdr* elf_phdata;
+    int eager; // apager: populate every PT_LOAD page before jumping to the entry point.
+    struct elf_stream* stream; // non-NULL while the image may still be arriving.
+    int shared; // apager: map file-backed pages from a post-load image shared across instances.
 };
 
 uintptr_t load_elf_binary(struct binary_file* fp);
@@ -24,3 +56,5 @@ uintptr_t load_elf_binary(struct binary_file* fp);
 struct binary_file *parse_file(int argc, char** argv, char** envp);
 
 int padzero(unsigned long elf_bss);
+
+int stream_wait(struct elf_stream* s, unsigned long end);
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <elf.h>
+
+#include "parser.h"
+
+/**
+ * Emits a load plan header for a static guest: every mmap, anonymous BSS
+ * mapping and zero fill apager would perform, with the addresses already
+ * resolved, plus the identity the loader checks before replaying it.
+ * Usage: plangen <guest> > load_plan.h
+ */
+int main(int argc, char** argv) {
+    Elf64_Ehdr elf_ex;
+    Elf64_Phdr *elf_phdata, *elf_ppnt;
+    unsigned long phdr_addr = 0, file_end, mem_end;
+    struct stat st;
+    int fd, i, size, writable, nzero = 0;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <guest>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    fd = open(argv[1], O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || pread(fd, &elf_ex, sizeof(elf_ex), 0) != sizeof(elf_ex)) {
+        perror("plangen: Failed to read ELF header");
+        exit(EXIT_FAILURE);
+    }
+
+    // Plans hold absolute addresses, so only fixed-address executables qualify.
+    if (elf_ex.e_type != ET_EXEC) {
+        fprintf(stderr, "plangen: %s is not a static ET_EXEC binary.\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    size = sizeof(Elf64_Phdr) * elf_ex.e_phnum;
+    elf_phdata = malloc(size);
+    if (!elf_phdata || pread(fd, elf_phdata, size, elf_ex.e_phoff) != size) {
+        perror("plangen: Failed to read ELF program headers");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("// Generated by plangen from %s. Do not edit.\n", argv[1]);
+    printf("#define PLAN_SIZE %ldL\n", (long) st.st_size);
+    printf("#define PLAN_MTIME_SEC %ldL\n", (long) st.st_mtim.tv_sec);
+    printf("#define PLAN_MTIME_NSEC %ldL\n", (long) st.st_mtim.tv_nsec);
+    printf("#define PLAN_ENTRY 0x%lxUL\n", (unsigned long) elf_ex.e_entry);
+    printf("#define PLAN_PHNUM %d\n", elf_ex.e_phnum);
+
+    // File-backed pages, then anonymous BSS pages, in program header order.
+    printf("static const struct plan_map plan_maps[] = {\n");
+    for (i = 0, elf_ppnt = elf_phdata; i < elf_ex.e_phnum; i++, elf_ppnt++) {
+        if (elf_ppnt->p_type != PT_LOAD)
+            continue;
+        file_end = ELF_PAGEALIGN(elf_ppnt->p_vaddr + elf_ppnt->p_filesz);
+        mem_end = ELF_PAGEALIGN(elf_ppnt->p_vaddr + elf_ppnt->p_memsz);
+        writable = !!(elf_ppnt->p_flags & PF_W);
+        if (elf_ppnt->p_filesz)
+            printf("    { 0x%lxUL, 0x%lxUL, 0x%lxL, %d },\n",
+                (unsigned long) ELF_PAGESTART(elf_ppnt->p_vaddr),
+                file_end - ELF_PAGESTART(elf_ppnt->p_vaddr),
+                (unsigned long) (elf_ppnt->p_offset - ELF_PAGEOFFSET(elf_ppnt->p_vaddr)), writable);
+        else
+            file_end = ELF_PAGESTART(elf_ppnt->p_vaddr);
+        if (mem_end > file_end)
+            printf("    { 0x%lxUL, 0x%lxUL, -1L, %d },\n", file_end, mem_end - file_end, writable);
+
+        if (elf_ppnt->p_offset <= elf_ex.e_phoff && elf_ex.e_phoff < elf_ppnt->p_offset + elf_ppnt->p_filesz)
+            phdr_addr = elf_ex.e_phoff - elf_ppnt->p_offset + elf_ppnt->p_vaddr;
+    }
+    printf("};\n");
+
+    // Tails of file-backed pages that belong to the BSS. The trailing row only
+    // keeps the array non-empty; the loader replays PLAN_NZERO entries.
+    printf("static const struct plan_range plan_zero[] = {\n");
+    for (i = 0, elf_ppnt = elf_phdata; i < elf_ex.e_phnum; i++, elf_ppnt++) {
+        if (elf_ppnt->p_type != PT_LOAD || elf_ppnt->p_memsz <= elf_ppnt->p_filesz || !elf_ppnt->p_filesz)
+            continue;
+        if (ELF_PAGEOFFSET(elf_ppnt->p_vaddr + elf_ppnt->p_filesz)) {
+            printf("    { 0x%lxUL, 0x%lxUL },\n",
+                (unsigned long) (elf_ppnt->p_vaddr + elf_ppnt->p_filesz),
+                (unsigned long) ELF_PAGEALIGN(elf_ppnt->p_vaddr + elf_ppnt->p_filesz));
+            nzero++;
+        }
+    }
+    printf("    { 0, 0 },\n");
+    printf("};\n");
+    printf("#define PLAN_NZERO %d\n", nzero);
+
+    printf("#define PLAN_PHDR 0x%lxUL\n", phdr_addr);
+
+    free(elf_phdata);
+    close(fd);
+    return 0;
+}